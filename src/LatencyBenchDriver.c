@@ -0,0 +1,188 @@
+/*
+ * LatencyBenchDriver.c - per-operation malloc latency microbenchmarks
+ *
+ *   Measures individual mm_malloc and mm_free calls with the cycle
+ *   counter (start_counter/get_counter from clock.c) and reports
+ *   latency percentiles -- p50, p99, p999 -- plus the mean, in cycles
+ *   and nanoseconds.  Three scenarios per size:
+ *
+ *     pair      back-to-back malloc/free of the same size
+ *     churn     random-slot replacement over a big working set
+ *     coalesce  frees in shuffled address order, so most frees merge
+ *               with one or both neighbors
+ *
+ *   Usage: LatencyBenchDriver [-v]
+ *     -v also prints the fcyc() k-best estimate of a whole pair, with
+ *        the cache-clearing and compensation knobs enabled
+ */
+#include "mm.h"
+#include "memlib.h"
+#include "fsecs.h"
+#include "fcyc.h"
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int verbose = 0;        /* global flag for verbose output */
+
+#define SAMPLES 20000
+#define CHURN_SLOTS 1024
+/* Live bytes any scenario may hold at once; well under one arena region. */
+#define WORKING_SET (1 << 21)
+
+static double Mhz;
+static double mallocLat[SAMPLES];
+static double freeLat[SAMPLES];
+
+static const size_t sizes[] = {16, 64, 256, 1024, 4096, 32768};
+#define NUM_SIZES ((int)(sizeof(sizes) / sizeof(sizes[0])))
+
+static int cmpDouble(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/* Percentile of a sorted sample array. */
+static double pct(double* sorted, int n, double p) {
+  return sorted[(int)(p * (n - 1))];
+}
+
+static void report(const char* scenario, size_t size, const char* op,
+                   double* lat, int n) {
+  double mean = 0;
+  int i;
+
+  for (i = 0; i < n; i++) mean += lat[i];
+  mean /= n;
+  qsort(lat, n, sizeof(double), cmpDouble);
+
+  printf("%-8s %7zu  %-6s %9.0f %9.0f %9.0f %9.0f %8.0f\n",
+         scenario, size, op, mean, pct(lat, n, 0.50), pct(lat, n, 0.99),
+         pct(lat, n, 0.999), pct(lat, n, 0.999) * 1000.0 / Mhz);
+}
+
+/* Back-to-back malloc/free pairs of one size. */
+static void benchPair(size_t size) {
+  int i;
+
+  for (i = 0; i < SAMPLES; i++) {
+    void* p;
+    start_counter();
+    p = mm_malloc(size);
+    mallocLat[i] = get_counter();
+    if (!p) { fprintf(stderr, "OOM in pair bench\n"); exit(1); }
+
+    start_counter();
+    mm_free(p);
+    freeLat[i] = get_counter();
+  }
+  report("pair", size, "malloc", mallocLat, SAMPLES);
+  report("pair", size, "free", freeLat, SAMPLES);
+}
+
+/* Random-slot replacement: each op frees an old block and allocates a
+   new one, the pattern request-scoped churn produces. */
+static void benchChurn(size_t size) {
+  static void* slots[CHURN_SLOTS];
+  int numSlots = (int)(WORKING_SET / (size + 32));
+  int i;
+
+  if (numSlots > CHURN_SLOTS) numSlots = CHURN_SLOTS;
+  memset(slots, 0, sizeof(slots));
+  for (i = 0; i < SAMPLES; i++) {
+    int slot = rand() % numSlots;
+
+    if (slots[slot]) {
+      start_counter();
+      mm_free(slots[slot]);
+      freeLat[i] = get_counter();
+    } else {
+      freeLat[i] = 0;
+    }
+    start_counter();
+    slots[slot] = mm_malloc(size);
+    mallocLat[i] = get_counter();
+    if (!slots[slot]) { fprintf(stderr, "OOM in churn bench\n"); exit(1); }
+  }
+  for (i = 0; i < numSlots; i++)
+    if (slots[i]) mm_free(slots[i]);
+
+  report("churn", size, "malloc", mallocLat, SAMPLES);
+  report("churn", size, "free", freeLat, SAMPLES);
+}
+
+/* Allocate a long run of equal blocks, then free them in shuffled
+   address order so most frees coalesce with a neighbor. */
+static void benchCoalesce(size_t size) {
+  static void* blocks[SAMPLES];
+  static int order[SAMPLES];
+  int n = (int)(WORKING_SET / (size + 32));
+  int i;
+
+  if (n > SAMPLES) n = SAMPLES;
+  for (i = 0; i < n; i++) {
+    blocks[i] = mm_malloc(size);
+    if (!blocks[i]) { fprintf(stderr, "OOM in coalesce bench\n"); exit(1); }
+    order[i] = i;
+  }
+  for (i = n - 1; i > 0; i--) {
+    int j = rand() % (i + 1);
+    int tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+  }
+
+  for (i = 0; i < n; i++) {
+    start_counter();
+    mm_free(blocks[order[i]]);
+    freeLat[i] = get_counter();
+  }
+  report("coalesce", size, "free", freeLat, n);
+}
+
+/* fcyc() needs a void(void*) function to measure. */
+static void pairOnce(void* sizePtr) {
+  void* p = mm_malloc(*(size_t*)sizePtr);
+  mm_free(p);
+}
+
+int main(int argc, char* argv[]) {
+  int s;
+
+  if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = 1;
+
+  mem_init();
+  mem_reset_brk();
+  if (mm_init() < 0) {
+    printf("Error in mm_init\n");
+    return -1;
+  }
+
+  init_fsecs();
+  Mhz = mhz(verbose);
+  srand(1);
+
+  printf("%-8s %7s  %-6s %9s %9s %9s %9s %8s\n",
+         "scenario", "size", "op", "mean", "p50", "p99", "p999", "p999ns");
+  for (s = 0; s < NUM_SIZES; s++) {
+    benchPair(sizes[s]);
+    benchChurn(sizes[s]);
+  }
+  /* Coalescing pressure only exists off the slab/tcache path, and the
+     bigger sizes cannot field enough blocks for stable percentiles. */
+  for (s = 0; s < NUM_SIZES; s++) {
+    if (sizes[s] <= 64 || sizes[s] > 1024) continue;
+    benchCoalesce(sizes[s]);
+  }
+
+  if (verbose) {
+    size_t size = 256;
+
+    set_fcyc_clear_cache(1);
+    set_fcyc_compensate(1);
+    printf("fcyc k-best malloc/free pair (256 B, cold cache): %.0f cycles\n",
+           fcyc(pairOnce, &size));
+  }
+  return 0;
+}
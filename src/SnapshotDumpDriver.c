@@ -0,0 +1,175 @@
+/*
+ * SnapshotDumpDriver.c - offline pretty-printer for mm_snapshot files
+ *
+ *   Decodes the binary heap snapshot written by mm_snapshot() (format
+ *   in mm.h) and reproduces examine_heap's output from it: one line
+ *   per block, the per-class free-list chains and the large-block
+ *   skiplist for every arena, then the mmap'd chunks.  Printed
+ *   pointers are the addresses the heap had when the snapshot was
+ *   taken, so the dump diffs cleanly against a live examine_heap.
+ *
+ *   Usage: SnapshotDumpDriver <snapshot-file>
+ */
+#include "mm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int verbose = 0;
+
+/* Tag bits and the size mask, as laid down in mm.c. */
+#define TAG_USED 1
+#define TAG_PRECEDING_USED 2
+#define SIZE(x) ((x) & ~(uint32_t)15)
+
+static const char* path;
+
+static void fail(const char* why) {
+  fprintf(stderr, "SnapshotDumpDriver: %s: %s\n", path, why);
+  exit(1);
+}
+
+static void readRecord(FILE* in, void* rec, size_t size) {
+  if (fread(rec, size, 1, in) != 1) fail("truncated snapshot");
+}
+
+/* One arena's block records, in address order as written. */
+static mm_snapshot_block_t* blocks;
+static size_t blockCount;
+static size_t blockCap;
+
+/* Look a block up by its offset; records are sorted by address. */
+static mm_snapshot_block_t* blockAt(uint32_t offset) {
+  size_t lo = 0;
+  size_t hi = blockCount;
+
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (blocks[mid].offset < offset) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo < blockCount && blocks[lo].offset == offset) return &blocks[lo];
+  return NULL;
+}
+
+static void dumpArena(FILE* in, const mm_snapshot_arena_t* arena) {
+  char* base = (char*)(size_t)arena->base;
+  size_t i;
+  int index;
+
+  blockCount = 0;
+  for (;;) {
+    mm_snapshot_block_t blk;
+
+    readRecord(in, &blk, sizeof(blk));
+    if (blockCount == blockCap) {
+      blockCap = blockCap ? 2 * blockCap : 4096;
+      blocks = realloc(blocks, blockCap * sizeof(*blocks));
+      if (!blocks) fail("out of memory");
+    }
+    blocks[blockCount++] = blk;
+    if (SIZE(blk.size_and_tags) == 0) break; // the epilogue record
+  }
+
+  printf("arena %d heap size:\t0x%lx\n", (int)arena->region,
+         (unsigned long)arena->heap_size);
+  printf("heap start:\t%p\n", (void*)base);
+  printf("heap end:\t%p\n", (void*)(base + arena->heap_size));
+
+  for (i = 0; i + 1 < blockCount; i++) { // all but the epilogue
+    mm_snapshot_block_t* blk = &blocks[i];
+
+    printf("%p: %ld\t", (void*)(base + blk->offset),
+           (long)SIZE(blk->size_and_tags));
+    if (blk->size_and_tags & TAG_USED) {
+      printf("ALLOCATED\tpreceding used: %d\n",
+             !!(blk->size_and_tags & TAG_PRECEDING_USED));
+    } else if (blk->link1 & MM_SNAPSHOT_LARGE) {
+      printf("FREE (large)\tskip level: %d, preceding used: %d\n",
+             (int)(blk->link1 & ~MM_SNAPSHOT_LARGE),
+             !!(blk->size_and_tags & TAG_PRECEDING_USED));
+    } else {
+      printf("FREE\tnextFree: %p, prevFree: %p, preceding used: %d\n",
+             blk->link0 ? (void*)(base + blk->link0) : NULL,
+             blk->link1 ? (void*)(base + blk->link1) : NULL,
+             !!(blk->size_and_tags & TAG_PRECEDING_USED));
+    }
+  }
+  printf("END OF HEAP\n\n");
+
+  for (index = 0; index < MM_NUM_SIZE_CLASSES; index++) {
+    mm_snapshot_block_t* curr = blockAt(arena->free_heads[index]);
+    size_t steps = 0;
+
+    if (!arena->free_heads[index]) continue;
+    printf("Class %d ", index);
+    while (curr && steps++ <= blockCount) { // cap guards corrupt links
+      printf("-> %p ", (void*)(base + curr->offset));
+      curr = curr->link0 ? blockAt(curr->link0) : NULL;
+    }
+    printf("\n");
+  }
+
+  if (arena->large_head) {
+    mm_snapshot_block_t* curr = blockAt(arena->large_head);
+    size_t steps = 0;
+
+    printf("Large ");
+    while (curr && steps++ <= blockCount) {
+      printf("-> %p (%ld) ", (void*)(base + curr->offset),
+             (long)SIZE(curr->size_and_tags));
+      curr = curr->link0 ? blockAt(curr->link0) : NULL;
+    }
+    printf("\n");
+  }
+}
+
+static void dumpChunks(FILE* in, const mm_snapshot_arena_t* marker) {
+  uint64_t i;
+
+  for (i = 0; i < marker->heap_size; i++) {
+    mm_snapshot_chunk_t chunk;
+
+    readRecord(in, &chunk, sizeof(chunk));
+    printf("%p: %ld\t%s (mmap)\tmapping: %lu bytes\n",
+           (void*)(size_t)chunk.address,
+           (long)(chunk.size_and_tags & ~(uint64_t)15),
+           (chunk.size_and_tags & TAG_USED) ? "ALLOCATED" : "FREE",
+           (unsigned long)chunk.map_size);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  mm_snapshot_header_t header;
+  FILE* in;
+
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <snapshot-file>\n", argv[0]);
+    return 1;
+  }
+  path = argv[1];
+  in = fopen(path, "rb");
+  if (!in) {
+    perror(path);
+    return 1;
+  }
+
+  readRecord(in, &header, sizeof(header));
+  if (header.magic != MM_SNAPSHOT_MAGIC) fail("not an mm_snapshot file");
+  if (header.version != MM_SNAPSHOT_VERSION) fail("unknown snapshot version");
+
+  for (;;) {
+    mm_snapshot_arena_t arena;
+
+    readRecord(in, &arena, sizeof(arena));
+    if (arena.region == MM_SNAPSHOT_MMAP) {
+      dumpChunks(in, &arena);
+      break;
+    }
+    dumpArena(in, &arena);
+  }
+
+  fclose(in);
+  free(blocks);
+  return 0;
+}
@@ -0,0 +1,386 @@
+/*
+ * StressBenchDriver.c - multithreaded stress and scalability benchmarks
+ *
+ *   The fsecs/fcyc timing layer can only time one function in one
+ *   thread, so this driver measures the allocator the way deployments
+ *   use it: n threads hammering mm_malloc/mm_free at once.  It runs
+ *   the same workload at 1, 2, 4, ... threads and prints one line per
+ *   thread count -- total and per-thread ops/sec, speedup over the
+ *   single-threaded run, and malloc latency percentiles -- so a
+ *   regression in core scaling shows up as a bent curve.
+ *
+ *   The default workload is random-slot churn: each thread replaces
+ *   blocks in its own slot table, giving geometrically distributed
+ *   lifetimes with mean proportional to the slot count.  Sizes are
+ *   log-uniform between the bounds, and a configurable fraction of
+ *   frees is handed to a random sibling thread, which exercises the
+ *   remote-free queues.  Producer/consumer mode instead dedicates half
+ *   the threads to allocating and half to freeing what the producers
+ *   hand over, so every single free takes the remote path.
+ *
+ *   Usage: StressBenchDriver [-t maxthreads] [-n ops] [-s min:max]
+ *                            [-x crossratio] [-l slots] [-p] [-v]
+ *     -t  top of the scalability curve (default: online cores)
+ *     -n  operations per thread and run (default 200000)
+ *     -s  size bounds in bytes (default 16:2048)
+ *     -x  fraction of frees pushed to another thread (default 0.1)
+ *     -l  slots per thread, i.e. mean block lifetime (default 256)
+ *     -p  producer/consumer mode (curve starts at 2 threads)
+ *     -v  also print each thread's own ops/sec
+ */
+#include "mm.h"
+#include "memlib.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+int verbose = 0;        /* global flag for verbose output */
+
+#define MAX_THREADS 32
+#define MAX_SLOTS 4096
+/* Latency is sampled, not measured per op: one timed malloc (or free,
+   for consumers) every LAT_PERIOD keeps the clock_gettime overhead out
+   of the throughput numbers. */
+#define LAT_SAMPLES 4096
+#define LAT_PERIOD 16
+/* Kept shallow: blocks parked in a ring are still live, and a deep
+   backlog of large ones can outgrow a heap region. */
+#define RING_SIZE 64
+
+static int maxThreads = 0;
+static long opsPerThread = 200000;
+static size_t minSize = 16;
+static size_t maxSize = 2048;
+static double crossRatio = 0.1;
+static int numSlots = 256;
+static int prodCons = 0;
+
+/* A bounded mailbox of blocks for another thread to free.  A full ring
+   means the receiver is behind; the sender then frees locally rather
+   than block, so the benchmark measures the allocator, not the ring. */
+typedef struct {
+  pthread_mutex_t lock;
+  void* ptrs[RING_SIZE];
+  int head;
+  int count;
+} Ring;
+
+typedef struct {
+  int id;
+  int numThreads;
+  unsigned seed;
+  long ops;
+  double secs;
+  int latCount;
+  double lat[LAT_SAMPLES];
+  Ring inbox;
+  void* slots[MAX_SLOTS];
+} Worker;
+
+static Worker workers[MAX_THREADS];
+static pthread_barrier_t startBarrier;
+static int producersLeft;
+static int sizeBuckets; /* log2(maxSize / minSize), for log-uniform sizes */
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int ringPush(Ring* ring, void* ptr) {
+  int pushed = 0;
+
+  pthread_mutex_lock(&ring->lock);
+  if (ring->count < RING_SIZE) {
+    ring->ptrs[(ring->head + ring->count++) % RING_SIZE] = ptr;
+    pushed = 1;
+  }
+  pthread_mutex_unlock(&ring->lock);
+  return pushed;
+}
+
+static void* ringPop(Ring* ring) {
+  void* ptr = NULL;
+
+  pthread_mutex_lock(&ring->lock);
+  if (ring->count > 0) {
+    ptr = ring->ptrs[ring->head];
+    ring->head = (ring->head + 1) % RING_SIZE;
+    ring->count--;
+  }
+  pthread_mutex_unlock(&ring->lock);
+  return ptr;
+}
+
+/* Free up to limit blocks other threads handed us. */
+static int drainInbox(Worker* w, int limit) {
+  int n = 0;
+  void* ptr;
+
+  while (n < limit && (ptr = ringPop(&w->inbox)) != NULL) {
+    mm_free(ptr);
+    n++;
+  }
+  return n;
+}
+
+/* Log-uniform size in [minSize, maxSize]: pick a power-of-two decade,
+   then a uniform size inside it, so small sizes are as common as large
+   ones on a log scale -- the shape real size mixes have. */
+static size_t pickSize(unsigned* seed) {
+  size_t lo = minSize << (rand_r(seed) % (sizeBuckets + 1));
+  size_t hi = (lo * 2 <= maxSize) ? lo * 2 : maxSize;
+
+  if (lo >= hi) return hi;
+  return lo + (size_t)rand_r(seed) % (hi - lo + 1);
+}
+
+static void* timedMalloc(Worker* w, long i, size_t size) {
+  void* ptr;
+
+  if (i % LAT_PERIOD == 0 && w->latCount < LAT_SAMPLES) {
+    double t = now();
+
+    ptr = mm_malloc(size);
+    w->lat[w->latCount++] = (now() - t) * 1e9;
+  } else {
+    ptr = mm_malloc(size);
+  }
+  if (!ptr) {
+    fprintf(stderr, "OOM in stress bench\n");
+    exit(1);
+  }
+  memset(ptr, w->id + 1, size < 64 ? size : 64);
+  return ptr;
+}
+
+/* Random-slot churn with a crossRatio chance of handing each free to a
+   random sibling's inbox instead of freeing it here. */
+static void* churnWorker(void* arg) {
+  Worker* w = (Worker*)arg;
+  double t0;
+  long i;
+
+  pthread_barrier_wait(&startBarrier);
+  t0 = now();
+  for (i = 0; i < opsPerThread; i++) {
+    int s = rand_r(&w->seed) % numSlots;
+
+    if ((i & 15) == 0) drainInbox(w, 8);
+    if (w->slots[s]) {
+      void* ptr = w->slots[s];
+
+      w->slots[s] = NULL;
+      if (w->numThreads > 1 &&
+          rand_r(&w->seed) < crossRatio * (double)RAND_MAX) {
+        Worker* peer = &workers[rand_r(&w->seed) % w->numThreads];
+
+        if (peer == w || !ringPush(&peer->inbox, ptr)) mm_free(ptr);
+      } else {
+        mm_free(ptr);
+      }
+    } else {
+      w->slots[s] = timedMalloc(w, i, pickSize(&w->seed));
+    }
+  }
+  w->secs = now() - t0;
+  w->ops = opsPerThread;
+  return NULL;
+}
+
+/* Producer half of -p mode: allocate and deal the blocks round-robin
+   to the consumers' inboxes. */
+static void* producerWorker(void* arg) {
+  Worker* w = (Worker*)arg;
+  int firstConsumer = (w->numThreads + 1) / 2;
+  int numConsumers = w->numThreads - firstConsumer;
+  double t0;
+  long i;
+
+  pthread_barrier_wait(&startBarrier);
+  t0 = now();
+  for (i = 0; i < opsPerThread; i++) {
+    void* ptr = timedMalloc(w, i, pickSize(&w->seed));
+    Worker* consumer = &workers[firstConsumer + (int)(i % numConsumers)];
+
+    if (!ringPush(&consumer->inbox, ptr)) mm_free(ptr);
+  }
+  w->secs = now() - t0;
+  w->ops = opsPerThread;
+  __atomic_sub_fetch(&producersLeft, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/* Consumer half of -p mode: free whatever arrives, every block from
+   another thread's arena, until the producers finish and the inbox
+   runs dry. */
+static void* consumerWorker(void* arg) {
+  Worker* w = (Worker*)arg;
+  double t0;
+
+  pthread_barrier_wait(&startBarrier);
+  t0 = now();
+  for (;;) {
+    void* ptr = ringPop(&w->inbox);
+
+    if (ptr) {
+      if (w->ops % LAT_PERIOD == 0 && w->latCount < LAT_SAMPLES) {
+        double t = now();
+
+        mm_free(ptr);
+        w->lat[w->latCount++] = (now() - t) * 1e9;
+      } else {
+        mm_free(ptr);
+      }
+      w->ops++;
+    } else if (__atomic_load_n(&producersLeft, __ATOMIC_ACQUIRE) == 0) {
+      if (drainInbox(w, RING_SIZE) == 0) break;
+    } else {
+      sched_yield();
+    }
+  }
+  w->secs = now() - t0;
+  return NULL;
+}
+
+static int cmpDouble(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static double pct(double* sorted, int n, double p) {
+  return sorted[(int)(p * (n - 1))];
+}
+
+/* One run at a given thread count; returns total ops/sec. */
+static double runOnce(int numThreads) {
+  static double allLat[MAX_THREADS * LAT_SAMPLES];
+  pthread_t tids[MAX_THREADS];
+  double slowest = 0;
+  long totalOps = 0;
+  int latCount = 0;
+  double rate;
+  int t;
+
+  mem_reset_brk();
+  if (mm_init() < 0) {
+    printf("Error in mm_init\n");
+    exit(1);
+  }
+
+  memset(workers, 0, sizeof(workers));
+  for (t = 0; t < numThreads; t++) {
+    workers[t].id = t;
+    workers[t].numThreads = numThreads;
+    workers[t].seed = (unsigned)(t * 2654435761u + 17u);
+    pthread_mutex_init(&workers[t].inbox.lock, NULL);
+  }
+  pthread_barrier_init(&startBarrier, NULL, numThreads);
+  producersLeft = prodCons ? (numThreads + 1) / 2 : 0;
+
+  for (t = 0; t < numThreads; t++) {
+    void* (*fn)(void*) = churnWorker;
+
+    if (prodCons) fn = (t < (numThreads + 1) / 2) ? producerWorker
+                                                  : consumerWorker;
+    if (pthread_create(&tids[t], NULL, fn, &workers[t]) != 0) {
+      fprintf(stderr, "pthread_create failed\n");
+      exit(1);
+    }
+  }
+  for (t = 0; t < numThreads; t++) pthread_join(tids[t], NULL);
+  pthread_barrier_destroy(&startBarrier);
+
+  /* Free what the run left behind so back-to-back runs start equal. */
+  for (t = 0; t < numThreads; t++) {
+    int s;
+
+    drainInbox(&workers[t], RING_SIZE);
+    for (s = 0; s < numSlots; s++)
+      if (workers[t].slots[s]) mm_free(workers[t].slots[s]);
+    pthread_mutex_destroy(&workers[t].inbox.lock);
+  }
+
+  for (t = 0; t < numThreads; t++) {
+    totalOps += workers[t].ops;
+    if (workers[t].secs > slowest) slowest = workers[t].secs;
+    memcpy(allLat + latCount, workers[t].lat,
+           workers[t].latCount * sizeof(double));
+    latCount += workers[t].latCount;
+    if (verbose)
+      printf("  thread %d: %.0f ops/sec\n", t,
+             (double)workers[t].ops / workers[t].secs);
+  }
+  qsort(allLat, latCount, sizeof(double), cmpDouble);
+
+  rate = (double)totalOps / slowest;
+  printf("%7d %12.0f %12.0f %9.0f %9.0f %9.0f\n", numThreads, rate,
+         rate / numThreads, pct(allLat, latCount, 0.50),
+         pct(allLat, latCount, 0.99), pct(allLat, latCount, 0.999));
+  return rate;
+}
+
+int main(int argc, char* argv[]) {
+  double base = 0;
+  int numThreads;
+  int c;
+
+  while ((c = getopt(argc, argv, "t:n:s:x:l:pv")) != -1) {
+    switch (c) {
+      case 't': maxThreads = atoi(optarg); break;
+      case 'n': opsPerThread = atol(optarg); break;
+      case 's':
+        if (sscanf(optarg, "%zu:%zu", &minSize, &maxSize) != 2 ||
+            minSize < 1 || minSize > maxSize) {
+          fprintf(stderr, "bad size bounds: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'x': crossRatio = atof(optarg); break;
+      case 'l': numSlots = atoi(optarg); break;
+      case 'p': prodCons = 1; break;
+      case 'v': verbose = 1; break;
+      default:
+        fprintf(stderr,
+                "Usage: %s [-t maxthreads] [-n ops] [-s min:max]"
+                " [-x crossratio] [-l slots] [-p] [-v]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (maxThreads <= 0) maxThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (maxThreads > MAX_THREADS) maxThreads = MAX_THREADS;
+  if (numSlots < 1 || numSlots > MAX_SLOTS) numSlots = MAX_SLOTS;
+  while ((minSize << sizeBuckets) < maxSize) sizeBuckets++;
+
+  mem_init();
+
+  printf("mode: %s, sizes %zu..%zu, %ld ops/thread, cross-free %.0f%%,"
+         " %d slots\n", prodCons ? "producer/consumer" : "churn",
+         minSize, maxSize, opsPerThread, crossRatio * 100, numSlots);
+  printf("%7s %12s %12s %9s %9s %9s\n",
+         "threads", "ops/sec", "per-thread", "p50ns", "p99ns", "p999ns");
+
+  /* The curve: doubling thread counts, always ending at maxThreads. */
+  for (numThreads = prodCons ? 2 : 1; numThreads < maxThreads;
+       numThreads *= 2) {
+    double rate = runOnce(numThreads);
+
+    if (!base) base = rate;
+  }
+  if (maxThreads >= (prodCons ? 2 : 1)) {
+    double rate = runOnce(maxThreads);
+
+    if (!base) base = rate;
+    printf("speedup at %d threads over the first run: %.2fx\n", maxThreads,
+           rate / base);
+  }
+  return 0;
+}
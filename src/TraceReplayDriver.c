@@ -0,0 +1,302 @@
+/*
+ * TraceReplayDriver.c - replay malloc trace files against the mm package
+ *
+ *   Reads one or more trace files in the classic .rep format (a header
+ *   of four integers followed by one "a <id> <size>", "r <id> <size>"
+ *   or "f <id>" record per line), replays them through mm_malloc,
+ *   mm_realloc and mm_free, and reports for each trace:
+ *
+ *     - throughput in ops/sec, timed with fsecs()
+ *     - utilization: peak aggregate payload / heap bytes consumed,
+ *       measured with mem_heapsize()
+ *
+ *   Each replayed block is filled with an id-derived byte pattern that
+ *   is verified before it is freed or resized, so a trace run doubles
+ *   as a correctness check.
+ *
+ *   Usage: TraceReplayDriver [-v] tracefile ...
+ */
+#include "mm.h"
+#include "memlib.h"
+#include "fsecs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int verbose = 0;        /* global flag for verbose output */
+
+#define MAXLINE 1024
+
+/* Trace operation types */
+#define OP_ALLOC   0
+#define OP_FREE    1
+#define OP_REALLOC 2
+
+typedef struct {
+  int type;             /* OP_ALLOC, OP_FREE or OP_REALLOC */
+  int index;            /* block id the op refers to */
+  size_t size;          /* request size (unused for OP_FREE) */
+} TraceOp;
+
+typedef struct {
+  char *filename;
+  int num_ids;          /* number of distinct block ids */
+  int num_ops;          /* number of trace records */
+  TraceOp *ops;         /* the records, in trace order */
+  void **blocks;        /* live payload pointer per id during a replay */
+  size_t *sizes;        /* live payload size per id during a replay */
+} Trace;
+
+static Trace *readTrace(char *filename);
+static void freeTrace(Trace *trace);
+static void fillBlock(void *payload, size_t size, int index);
+static int checkBlock(void *payload, size_t size, int index);
+static int replayTrace(Trace *trace, size_t *peakPayload);
+static void timedReplay(void *tracePtr);
+
+/*
+ * readTrace - parse a trace file into a Trace record
+ */
+static Trace *readTrace(char *filename) {
+  FILE *file;
+  Trace *trace;
+  char type[MAXLINE];
+  int index, size, op, ignored;
+
+  if ((file = fopen(filename, "r")) == NULL) {
+    fprintf(stderr, "Could not open %s\n", filename);
+    return NULL;
+  }
+
+  trace = (Trace *)malloc(sizeof(Trace));
+  trace->filename = filename;
+
+  /* header: suggested heap size (ignored), #ids, #ops, weight (ignored) */
+  if (fscanf(file, "%d", &ignored) != 1 ||
+      fscanf(file, "%d", &trace->num_ids) != 1 ||
+      fscanf(file, "%d", &trace->num_ops) != 1 ||
+      fscanf(file, "%d", &ignored) != 1) {
+    fprintf(stderr, "Bad header in %s\n", filename);
+    fclose(file);
+    free(trace);
+    return NULL;
+  }
+
+  trace->ops = (TraceOp *)malloc(trace->num_ops * sizeof(TraceOp));
+  trace->blocks = (void **)calloc(trace->num_ids, sizeof(void *));
+  trace->sizes = (size_t *)calloc(trace->num_ids, sizeof(size_t));
+
+  for (op = 0; op < trace->num_ops; op++) {
+    if (fscanf(file, "%s", type) != 1)
+      break;
+    switch (type[0]) {
+    case 'a':
+      if (fscanf(file, "%d %d", &index, &size) != 2)
+        break;
+      trace->ops[op].type = OP_ALLOC;
+      trace->ops[op].index = index;
+      trace->ops[op].size = (size_t)size;
+      continue;
+    case 'r':
+      if (fscanf(file, "%d %d", &index, &size) != 2)
+        break;
+      trace->ops[op].type = OP_REALLOC;
+      trace->ops[op].index = index;
+      trace->ops[op].size = (size_t)size;
+      continue;
+    case 'f':
+      if (fscanf(file, "%d", &index) != 1)
+        break;
+      trace->ops[op].type = OP_FREE;
+      trace->ops[op].index = index;
+      trace->ops[op].size = 0;
+      continue;
+    }
+    fprintf(stderr, "Bad record %d in %s\n", op, filename);
+    fclose(file);
+    freeTrace(trace);
+    return NULL;
+  }
+  if (op != trace->num_ops) {
+    fprintf(stderr, "Trace %s ended after %d of %d records\n",
+            filename, op, trace->num_ops);
+    fclose(file);
+    freeTrace(trace);
+    return NULL;
+  }
+
+  fclose(file);
+  return trace;
+}
+
+/*
+ * freeTrace - release a Trace record
+ */
+static void freeTrace(Trace *trace) {
+  free(trace->ops);
+  free(trace->blocks);
+  free(trace->sizes);
+  free(trace);
+}
+
+/*
+ * fillBlock - write an id-derived pattern over a payload
+ */
+static void fillBlock(void *payload, size_t size, int index) {
+  memset(payload, index & 0xFF, size);
+}
+
+/*
+ * checkBlock - verify the pattern written by fillBlock is intact
+ */
+static int checkBlock(void *payload, size_t size, int index) {
+  unsigned char *bytes = (unsigned char *)payload;
+  size_t i;
+
+  for (i = 0; i < size; i++) {
+    if (bytes[i] != (unsigned char)(index & 0xFF)) {
+      fprintf(stderr, "Corrupted byte %zu in block %d\n", i, index);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * replayTrace - run one full pass of a trace through the mm package.
+ *    Tracks the aggregate payload high-water mark in *peakPayload when
+ *    it is non-NULL (the timed passes skip the bookkeeping). Returns 0
+ *    on success, -1 on any allocation failure or corruption.
+ */
+static int replayTrace(Trace *trace, size_t *peakPayload) {
+  size_t livePayload = 0;
+  int op, index;
+  size_t size, oldSize, checkSize;
+  void *payload;
+
+  mem_reset_brk();
+  if (mm_init() < 0) {
+    fprintf(stderr, "Error in mm_init\n");
+    return -1;
+  }
+
+  for (op = 0; op < trace->num_ops; op++) {
+    index = trace->ops[op].index;
+    size = trace->ops[op].size;
+
+    switch (trace->ops[op].type) {
+    case OP_ALLOC:
+      if ((payload = mm_malloc(size)) == NULL && size > 0) {
+        fprintf(stderr, "mm_malloc failed on op %d of %s\n",
+                op, trace->filename);
+        return -1;
+      }
+      trace->blocks[index] = payload;
+      trace->sizes[index] = size;
+      if (peakPayload != NULL) {
+        fillBlock(payload, size, index);
+        livePayload += size;
+        if (livePayload > *peakPayload)
+          *peakPayload = livePayload;
+      }
+      break;
+
+    case OP_REALLOC:
+      oldSize = trace->sizes[index];
+      if (peakPayload != NULL &&
+          checkBlock(trace->blocks[index], oldSize, index) < 0)
+        return -1;
+      if ((payload = mm_realloc(trace->blocks[index], size)) == NULL &&
+          size > 0) {
+        fprintf(stderr, "mm_realloc failed on op %d of %s\n",
+                op, trace->filename);
+        return -1;
+      }
+      trace->blocks[index] = payload;
+      trace->sizes[index] = size;
+      if (peakPayload != NULL) {
+        /* the surviving prefix must be preserved; repattern the rest */
+        checkSize = (oldSize < size) ? oldSize : size;
+        if (checkBlock(payload, checkSize, index) < 0)
+          return -1;
+        fillBlock(payload, size, index);
+        livePayload += size - oldSize;
+        if (livePayload > *peakPayload)
+          *peakPayload = livePayload;
+      }
+      break;
+
+    case OP_FREE:
+      if (peakPayload != NULL) {
+        if (checkBlock(trace->blocks[index], trace->sizes[index], index) < 0)
+          return -1;
+        livePayload -= trace->sizes[index];
+      }
+      mm_free(trace->blocks[index]);
+      trace->blocks[index] = NULL;
+      trace->sizes[index] = 0;
+      break;
+    }
+  }
+  return 0;
+}
+
+/*
+ * timedReplay - fsecs() callback; replays without the payload checks
+ */
+static void timedReplay(void *tracePtr) {
+  replayTrace((Trace *)tracePtr, NULL);
+}
+
+int main(int argc, char *argv[]) {
+  Trace *trace;
+  size_t peakPayload, heapBytes;
+  double secs, totalOpsPerSec = 0, totalUtil = 0;
+  int arg, numTraces = 0;
+
+  if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+    verbose = 1;
+    argv++;
+    argc--;
+  }
+  if (argc < 2) {
+    fprintf(stderr, "Usage: TraceReplayDriver [-v] tracefile ...\n");
+    return 1;
+  }
+
+  /* Initialize the simulated memory system in memlib.c */
+  mem_init();
+  init_fsecs();
+
+  printf("%-24s %10s %12s %6s\n", "trace", "ops", "ops/sec", "util");
+  for (arg = 1; arg < argc; arg++) {
+    if ((trace = readTrace(argv[arg])) == NULL)
+      return 1;
+
+    /* correctness and utilization pass */
+    peakPayload = 0;
+    if (replayTrace(trace, &peakPayload) < 0) {
+      freeTrace(trace);
+      return 1;
+    }
+    heapBytes = mem_heapsize();
+
+    /* timed passes */
+    secs = fsecs(timedReplay, trace);
+
+    printf("%-24s %10d %12.0f %5.0f%%\n", trace->filename, trace->num_ops,
+           (double)trace->num_ops / secs,
+           100.0 * (double)peakPayload / (double)heapBytes);
+    totalOpsPerSec += (double)trace->num_ops / secs;
+    totalUtil += (double)peakPayload / (double)heapBytes;
+    numTraces++;
+
+    freeTrace(trace);
+  }
+
+  printf("Average: %.0f ops/sec, %.0f%% utilization over %d trace(s)\n",
+         totalOpsPerSec / numTraces, 100.0 * totalUtil / numTraces,
+         numTraces);
+  return 0;
+}
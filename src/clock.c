@@ -0,0 +1,84 @@
+/*
+ * clock.c - routines for using the cycle counter.
+ *
+ *   On x86 the counter is read with rdtsc; elsewhere it falls back to
+ *   CLOCK_MONOTONIC nanoseconds, which keeps the interface working at
+ *   reduced resolution.  Restored to match the prototypes in clock.h,
+ *   which the original course handout shipped without sources.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "clock.h"
+
+/* Read the raw counter. */
+static unsigned long long read_cycles(void) {
+#if defined(__x86_64__)
+  unsigned int hi, lo;
+  __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((unsigned long long)hi << 32) | lo;
+#elif defined(__i386__)
+  unsigned long long cycles;
+  __asm__ __volatile__("rdtsc" : "=A"(cycles));
+  return cycles;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static unsigned long long counter_start = 0;
+
+/*
+ * start_counter - start (or reset) the cycle counter
+ */
+void start_counter(void) {
+  counter_start = read_cycles();
+}
+
+/*
+ * get_counter - return the number of cycles since the last call to
+ *    start_counter
+ */
+double get_counter(void) {
+  return (double)(read_cycles() - counter_start);
+}
+
+/*
+ * mhz_full - estimate the clock rate of the processor in MHz by
+ *    counting cycles across sleeptime intervals of 100 ms
+ */
+double mhz_full(int verbose, int sleeptime) {
+  struct timespec interval = {0, 100 * 1000 * 1000}; /* 100 ms */
+  unsigned long long cycles = 0;
+  double secs = 0;
+  int i;
+
+  for (i = 0; i < sleeptime; i++) {
+    struct timespec before, after;
+
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    start_counter();
+    nanosleep(&interval, NULL);
+    cycles += (unsigned long long)get_counter();
+    clock_gettime(CLOCK_MONOTONIC, &after);
+
+    secs += (double)(after.tv_sec - before.tv_sec) +
+            (double)(after.tv_nsec - before.tv_nsec) * 1e-9;
+  }
+
+  double rate = (double)cycles / (secs * 1e6);
+  if (verbose)
+    printf("Processor clock rate ~= %.1f MHz\n", rate);
+  return rate;
+}
+
+/*
+ * mhz - estimate the clock rate of the processor in MHz
+ */
+double mhz(int verbose) {
+  return mhz_full(verbose, 2);
+}
@@ -0,0 +1,17 @@
+/*
+ * clock.h - prototypes for the low-level cycle counter routines in
+ *    clock.c. The definitions are only linked when config.h selects
+ *    USE_FCYC.
+ */
+
+/* Start (or reset) the cycle counter */
+void start_counter(void);
+
+/* Return the number of cycles since the last call to start_counter */
+double get_counter(void);
+
+/* Estimate the clock rate of the processor in MHz */
+double mhz(int verbose);
+
+/* Like mhz, but with control over the number of sleep intervals used */
+double mhz_full(int verbose, int sleeptime);
@@ -0,0 +1,25 @@
+#ifndef __CONFIG_H_
+#define __CONFIG_H_
+
+/*
+ * config.h - malloc package configuration.
+ *
+ * This stands in for the course-provided config.h that could not be
+ * redistributed; it carries the knobs the rest of the tree expects.
+ */
+
+/* Maximum heap size in bytes, shared by all memlib regions. */
+#define MAX_HEAP (20*(1<<20))  /* 20 MB */
+
+/*
+ * Timing method for fsecs():
+ *   USE_FCYC   - cycle counter (fcyc package)
+ *   USE_ITIMER - interval timer
+ *   USE_GETTOD - gettimeofday
+ * Exactly one should be nonzero.
+ */
+#define USE_FCYC   1
+#define USE_ITIMER 0
+#define USE_GETTOD 0
+
+#endif /* __CONFIG_H_ */
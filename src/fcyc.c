@@ -0,0 +1,118 @@
+/*
+ * fcyc.c - estimate the time in CPU cycles used by a test function f.
+ *
+ *   Uses the k-best measurement scheme: run f repeatedly, keep the k
+ *   smallest samples, and stop once they agree to within epsilon (or a
+ *   sample budget runs out).  The smallest converged sample is the
+ *   estimate.  Restored to match the prototypes in fcyc.h, which the
+ *   original course handout shipped without sources.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fcyc.h"
+#include "clock.h"
+
+/* measurement parameters, adjusted with the set_fcyc_* functions */
+static double epsilon = 0.01;  /* convergence threshold */
+static int kbest = 3;          /* samples that must agree */
+static int maxsamples = 20;    /* give up after this many samples */
+static int clear_cache = 0;    /* flush the cache before each sample */
+static int compensate = 0;     /* subtract the timer's own overhead */
+
+#define CACHE_BYTES (1 << 22)  /* larger than any L2 we care about */
+#define CACHE_BLOCK 64
+
+static volatile char cache_buf[CACHE_BYTES];
+static volatile int cache_sink;
+
+static double samples[64];     /* kept sorted, smallest first */
+static int samplecount = 0;
+
+/* Touch every line of a large buffer to evict the caches. */
+static void clear(void) {
+  int sum = 0;
+  int i;
+
+  for (i = 0; i < CACHE_BYTES; i += CACHE_BLOCK)
+    sum += cache_buf[i];
+  cache_sink = sum;
+}
+
+/* Cycles consumed by an empty start_counter/get_counter pair. */
+static double timer_overhead(void) {
+  double best = 0;
+  int i;
+
+  for (i = 0; i < 10; i++) {
+    double t;
+
+    start_counter();
+    t = get_counter();
+    if (i == 0 || t < best) best = t;
+  }
+  return best;
+}
+
+/* Insert a new sample, keeping the smallest kbest sorted. */
+static void add_sample(double val) {
+  int pos = samplecount < kbest ? samplecount : kbest - 1;
+
+  if (samplecount < kbest || val < samples[kbest - 1]) {
+    while (pos > 0 && samples[pos - 1] > val) {
+      samples[pos] = samples[pos - 1];
+      pos--;
+    }
+    samples[pos] = val;
+  }
+  samplecount++;
+}
+
+/* Have the kbest smallest samples converged to within epsilon? */
+static int has_converged(void) {
+  return samplecount >= kbest &&
+         samples[kbest - 1] <= (1.0 + epsilon) * samples[0];
+}
+
+/*
+ * fcyc - Return the number of cycles used by f(argp)
+ */
+double fcyc(test_funct f, void *argp) {
+  double overhead = compensate ? timer_overhead() : 0.0;
+
+  samplecount = 0;
+  do {
+    double cyc;
+
+    if (clear_cache)
+      clear();
+    start_counter();
+    f(argp);
+    cyc = get_counter() - overhead;
+    if (cyc < 0) cyc = 0;
+    add_sample(cyc);
+  } while (!has_converged() && samplecount < maxsamples);
+
+  return samples[0];
+}
+
+void set_fcyc_epsilon(double epsilon_arg) {
+  epsilon = epsilon_arg;
+}
+
+void set_fcyc_k(int k) {
+  if (k > 0 && k <= (int)(sizeof(samples) / sizeof(samples[0])))
+    kbest = k;
+}
+
+void set_fcyc_maxsamples(int maxsamples_arg) {
+  maxsamples = maxsamples_arg;
+}
+
+void set_fcyc_clear_cache(int clear) {
+  clear_cache = clear;
+}
+
+void set_fcyc_compensate(int compensate_arg) {
+  compensate = compensate_arg;
+}
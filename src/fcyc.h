@@ -0,0 +1,30 @@
+/*
+ * fcyc.h - prototypes for the routines in fcyc.c that estimate the
+ *    time in CPU cycles used by a test function f. The definitions are
+ *    only linked when config.h selects USE_FCYC.
+ */
+typedef void (*test_funct)(void *);
+
+/* Compute the number of cycles used by test function f */
+double fcyc(test_funct f, void *argp);
+
+/*********************************************************
+ * Set the various parameters used by the measurement routines
+ *********************************************************/
+
+/* When set, keep collecting samples until the sample spread is below
+   epsilon (default: 0.01) */
+void set_fcyc_epsilon(double epsilon);
+
+/* Samples are collected until the k smallest (default: 3) agree to
+   within epsilon */
+void set_fcyc_k(int k);
+
+/* Maximum number of samples to collect (default: 20) */
+void set_fcyc_maxsamples(int maxsamples_arg);
+
+/* When set, clear the cache before each measurement (default: 0) */
+void set_fcyc_clear_cache(int clear);
+
+/* When set, compensate for the timer interrupt overhead (default: 0) */
+void set_fcyc_compensate(int compensate_arg);
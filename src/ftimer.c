@@ -0,0 +1,90 @@
+/*
+ * ftimer.c - Estimate the time (in seconds) used by a function f
+ *
+ *   Function timers provide portable timing at the granularity of the
+ *   system timer (typically 1-10 ms), either with the Unix interval
+ *   timer or with gettimeofday(). Both run f(argp) n times and return
+ *   the average running time of one call.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "ftimer.h"
+
+/* function prototypes */
+static double ftimer_itimer_helper(ftimer_test_funct f, void *argp, int n);
+static double ftimer_gettod_helper(ftimer_test_funct f, void *argp, int n);
+
+/*
+ * ftimer_itimer - Estimate the running time of f(argp) using the Unix
+ *    interval timer. Return the average of n runs.
+ */
+double ftimer_itimer(ftimer_test_funct f, void *argp, int n) {
+  return ftimer_itimer_helper(f, argp, n);
+}
+
+/*
+ * ftimer_gettod - Estimate the running time of f(argp) using
+ *    gettimeofday. Return the average of n runs.
+ */
+double ftimer_gettod(ftimer_test_funct f, void *argp, int n) {
+  return ftimer_gettod_helper(f, argp, n);
+}
+
+/*
+ * ftimer_itimer_helper - run f(argp) n times under the interval timer
+ *    and return the average elapsed virtual time of one run
+ */
+static double ftimer_itimer_helper(ftimer_test_funct f, void *argp, int n) {
+  struct itimerval timer, leftover;
+  double secs;
+  int i;
+
+  /* arm the timer with a value large enough that it cannot expire */
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 0;
+  timer.it_value.tv_sec = 86400; /* 1 day */
+  timer.it_value.tv_usec = 0;
+  if (setitimer(ITIMER_VIRTUAL, &timer, NULL) < 0) {
+    perror("setitimer");
+    exit(1);
+  }
+
+  for (i = 0; i < n; i++)
+    f(argp);
+
+  /* how much of the timer did the runs consume? */
+  if (getitimer(ITIMER_VIRTUAL, &leftover) < 0) {
+    perror("getitimer");
+    exit(1);
+  }
+  secs = (double)(timer.it_value.tv_sec - leftover.it_value.tv_sec) +
+         (double)(timer.it_value.tv_usec - leftover.it_value.tv_usec) * 1e-6;
+
+  /* disarm the timer */
+  timer.it_value.tv_sec = 0;
+  setitimer(ITIMER_VIRTUAL, &timer, NULL);
+
+  return secs / n;
+}
+
+/*
+ * ftimer_gettod_helper - run f(argp) n times bracketed by gettimeofday
+ *    and return the average elapsed wall time of one run
+ */
+static double ftimer_gettod_helper(ftimer_test_funct f, void *argp, int n) {
+  struct timeval start, finish;
+  double secs;
+  int i;
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < n; i++)
+    f(argp);
+  gettimeofday(&finish, NULL);
+
+  secs = (double)(finish.tv_sec - start.tv_sec) +
+         (double)(finish.tv_usec - start.tv_usec) * 1e-6;
+
+  return secs / n;
+}
@@ -1,13 +1,18 @@
 /*
- * memlib.c - a module that simulates the memory system.  Needed because it 
- *            allows us to interleave calls from the malloc package 
+ * memlib.c - a module that simulates the memory system.  Needed because it
+ *            allows us to interleave calls from the malloc package
  *            with the system's malloc package in libc.
+ *
+ *            The storage is carved into MEM_NUM_REGIONS equal regions,
+ *            each with its own brk, so the malloc package can run one
+ *            arena per region without the regions interleaving.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <string.h>
 #include <errno.h>
 
@@ -16,54 +21,272 @@
 
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */
+static size_t region_size;   /* bytes in each region */
+static char *region_brk[MEM_NUM_REGIONS]; /* first unused byte per region */
+static char *region_commit[MEM_NUM_REGIONS]; /* first uncommitted byte */
+static int region_node[MEM_NUM_REGIONS]; /* NUMA node per region, -1 unbound */
 
-/* 
+/*
  * mem_init - initialize the memory system model
+ *
+ *    The whole heap is only an address-space reservation: it is mapped
+ *    PROT_NONE and mem_sbrk commits pages on demand, so startup cost
+ *    and RSS track what the malloc package actually uses rather than
+ *    MAX_HEAP.
  */
 void mem_init(void) {
-  /* allocate the storage we will use to model the available VM */
-  if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-    fprintf(stderr, "mem_init_vm: malloc error\n");
+  int r;
+
+  /* reserve the address range we will use to model the available VM */
+  mem_start_brk = (char *)mmap(NULL, MAX_HEAP, PROT_NONE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                               -1, 0);
+  if (mem_start_brk == MAP_FAILED) {
+    fprintf(stderr, "mem_init_vm: mmap error\n");
     exit(1);
   }
 
-  mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-  mem_brk = mem_start_brk;                  /* heap is empty initially */
+  /* keep each region page-aligned so regions never share a page */
+  region_size = (MAX_HEAP / MEM_NUM_REGIONS) & ~((size_t)4095);
+  for (r = 0; r < MEM_NUM_REGIONS; r++) {
+    region_brk[r] = mem_region_lo(r); /* regions are empty initially */
+    region_commit[r] = region_brk[r]; /* and have no committed pages */
+    region_node[r] = -1;              /* first-touch placement */
+  }
+}
+
+/*
+ * mem_num_nodes - the number of NUMA nodes on this machine, read from
+ *    sysfs; 1 when the topology cannot be read.
+ */
+int mem_num_nodes(void) {
+  char path[64];
+  int n = 0;
+
+  for (;;) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", n);
+    if (access(path, F_OK) != 0) break;
+    n++;
+  }
+  return (n > 0) ? n : 1;
+}
+
+/* Ask the kernel to place a region's pages on one node before any of
+   them are touched.  mbind is called raw so the module does not grow a
+   libnuma dependency; MPOL_PREFERRED (rather than MPOL_BIND) falls back
+   to other nodes instead of failing when the preferred node is full. */
+#if defined(__linux__) && defined(SYS_mbind)
+#define MEM_MPOL_PREFERRED 1
+static int mem_bind_region(int region, int node) {
+  unsigned long nodemask = 1ul << node;
+
+  return (syscall(SYS_mbind, mem_region_lo(region), region_size,
+                  MEM_MPOL_PREFERRED, &nodemask, 8 * sizeof(nodemask),
+                  0) == 0) ? 0 : -1;
+}
+#endif
+
+/*
+ * mem_init_numa - mem_init plus NUMA placement: the regions are dealt
+ *    round-robin across the machine's nodes and each one is mbind'd to
+ *    its node, so a region's pages fault in node-local no matter which
+ *    thread first touches them.  On a single-node machine, or where
+ *    mbind is unavailable or refused, this is exactly mem_init.
+ */
+void mem_init_numa(void) {
+  mem_init();
+#if defined(__linux__) && defined(SYS_mbind)
+  int nodes = mem_num_nodes();
+  int r;
+
+  if (nodes <= 1) return;
+  for (r = 0; r < MEM_NUM_REGIONS; r++) {
+    if (mem_bind_region(r, r % nodes) == 0)
+      region_node[r] = r % nodes;
+  }
+#endif
+}
+
+/*
+ * mem_region_node - the NUMA node a region's pages are bound to, or -1
+ *    when the region uses first-touch placement
+ */
+int mem_region_node(int region) {
+  return region_node[region];
 }
 
-/* 
+/*
+ * mem_current_node - the NUMA node the calling thread is running on;
+ *    0 when the kernel cannot tell us
+ */
+int mem_current_node(void) {
+#if defined(__linux__) && defined(SYS_getcpu)
+  unsigned int cpu, node;
+
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) return (int)node;
+#endif
+  return 0;
+}
+
+/*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void) {
-  free(mem_start_brk);
+  munmap(mem_start_brk, MAX_HEAP);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointers to make empty regions.
+ *    Committed pages are handed back (PROT_NONE again), so a reset also
+ *    returns the old heap's RSS to the OS.
  */
 void mem_reset_brk() {
-  mem_brk = mem_start_brk;
+  int r;
+
+  for (r = 0; r < MEM_NUM_REGIONS; r++) {
+    char *lo = mem_region_lo(r);
+
+    if (region_commit[r] > lo) {
+      mprotect(lo, region_commit[r] - lo, PROT_NONE);
+      madvise(lo, region_commit[r] - lo, MADV_DONTNEED);
+    }
+    region_brk[r] = lo;
+    region_commit[r] = lo;
+  }
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+/*
+ * mem_region_lo - return address of the first byte of a region
  */
-void *mem_sbrk(size_t incr) {
-  char *old_brk = mem_brk;
+void *mem_region_lo(int region) {
+  return (void *)(mem_start_brk + region * region_size);
+}
+
+/*
+ * mem_region_size - return the capacity of a region in bytes
+ */
+size_t mem_region_size(int region) {
+  return region_size;
+}
+
+/*
+ * mem_region_used - return how many bytes of a region have been sbrk'd
+ */
+size_t mem_region_used(int region) {
+  return (size_t)(region_brk[region] - (char *)mem_region_lo(region));
+}
+
+/*
+ * mem_region_of - return the region containing p, or -1 if p is not in
+ *    the heap
+ */
+int mem_region_of(void *p) {
+  if ((char *)p < mem_start_brk || (char *)p >= mem_start_brk + MAX_HEAP)
+    return -1;
+
+  int region = ((char *)p - mem_start_brk) / region_size;
+  return (region < MEM_NUM_REGIONS) ? region : -1;
+}
 
-  if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ) {
+/*
+ * mem_sbrk_region - simple model of the sbrk function for one region.
+ *    Extends the region by incr bytes and returns the start address of
+ *    the new area. In this model, a region cannot be shrunk.
+ *
+ *    Pages are committed (made readable and writable) lazily here, the
+ *    first time the brk crosses them.
+ */
+void *mem_sbrk_region(int region, size_t incr) {
+  char *old_brk = region_brk[region];
+  char *max_addr = (char *)mem_region_lo(region) + region_size;
+  char *new_brk = old_brk + incr;
+
+  if ( (incr < 0) || (new_brk > max_addr) ) {
     errno = ENOMEM;
     fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
     return (void *)-1;
   }
-  mem_brk += incr;
+
+  if (new_brk > region_commit[region]) {
+    size_t page = (size_t)getpagesize();
+    char *commit_end = (char *)(((size_t)new_brk + page - 1) & ~(page - 1));
+
+    if (mprotect(region_commit[region], commit_end - region_commit[region],
+                 PROT_READ | PROT_WRITE) < 0) {
+      errno = ENOMEM;
+      fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit pages...\n");
+      return (void *)-1;
+    }
+    region_commit[region] = commit_end;
+  }
+
+  region_brk[region] = new_brk;
   return (void *)old_brk;
 }
 
+/*
+ * mem_shrink_region - give back the top decr bytes of a region.  Pages
+ *    past the new brk are decommitted, so RSS drops immediately; the
+ *    address range stays reserved and can be re-grown by mem_sbrk.
+ */
+void mem_shrink_region(int region, size_t decr) {
+  size_t page = (size_t)getpagesize();
+  char *new_brk = region_brk[region] - decr;
+  char *keep_end = (char *)(((size_t)new_brk + page - 1) & ~(page - 1));
+
+  if (decr > mem_region_used(region)) {
+    fprintf(stderr, "ERROR: mem_shrink_region past the region start\n");
+    return;
+  }
+
+  if (keep_end < region_commit[region]) {
+    mprotect(keep_end, region_commit[region] - keep_end, PROT_NONE);
+    madvise(keep_end, region_commit[region] - keep_end, MADV_DONTNEED);
+    region_commit[region] = keep_end;
+  }
+  region_brk[region] = new_brk;
+}
+
+/*
+ * mem_decommit - hint that a page-aligned span inside the heap holds no
+ *    useful data.  The pages stay mapped and writable, but the OS may
+ *    reclaim the physical memory behind them until they are next touched.
+ */
+void mem_decommit(void *addr, size_t len) {
+  madvise(addr, len, MADV_DONTNEED);
+}
+
+/*
+ * mem_sbrk - legacy single-heap interface; operates on region 0
+ */
+void *mem_sbrk(size_t incr) {
+  return mem_sbrk_region(0, incr);
+}
+
+/*
+ * mem_mmap - map size bytes of fresh zeroed storage outside the
+ *    simulated heap.  Unlike the sbrk regions this storage can be
+ *    returned to the OS, so the malloc package uses it for allocations
+ *    too big to live in a region.  Returns NULL on failure.
+ */
+void *mem_mmap(size_t size) {
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (p == MAP_FAILED) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return p;
+}
+
+/*
+ * mem_unmap - return a mem_mmap'd mapping to the OS
+ */
+void mem_unmap(void *ptr, size_t size) {
+  munmap(ptr, size);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -71,18 +294,25 @@ void *mem_heap_lo() {
   return (void *)mem_start_brk;
 }
 
-/* 
+/*
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi() {
-  return (void *)(mem_brk - 1);
+  return (void *)(mem_start_brk + MAX_HEAP - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the number of heap bytes in use across all
+ *    regions
  */
 size_t mem_heapsize() {
-  return (size_t)(mem_brk - mem_start_brk);
+  size_t total = 0;
+  int r;
+
+  for (r = 0; r < MEM_NUM_REGIONS; r++) {
+    total += mem_region_used(r);
+  }
+  return total;
 }
 
 /*
@@ -91,4 +321,3 @@ size_t mem_heapsize() {
 size_t mem_pagesize() {
   return (size_t)getpagesize();
 }
-
@@ -1,6 +1,13 @@
 #include <unistd.h>
 
+/* Number of independent heap regions the storage is carved into; the
+   malloc package runs one arena per region. */
+#define MEM_NUM_REGIONS 8
+
 void mem_init(void);
+/* mem_init with each region's pages bound round-robin to a NUMA node;
+   identical to mem_init on single-node machines. */
+void mem_init_numa(void);
 void mem_deinit(void);
 void *mem_sbrk(size_t incr);
 void mem_reset_brk(void);
@@ -9,3 +16,17 @@ void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+void *mem_mmap(size_t size);
+void mem_unmap(void *ptr, size_t size);
+
+void *mem_region_lo(int region);
+size_t mem_region_size(int region);
+size_t mem_region_used(int region);
+int mem_region_of(void *p);
+void *mem_sbrk_region(int region, size_t incr);
+void mem_shrink_region(int region, size_t decr);
+void mem_decommit(void *addr, size_t len);
+
+int mem_num_nodes(void);
+int mem_region_node(int region);
+int mem_current_node(void);
@@ -1,9 +1,161 @@
 #include <stdio.h>
+#include <stdint.h>
+
+/* Number of segregated size classes; mm_stats reports per-class counters. */
+#define MM_NUM_SIZE_CLASSES 20
+
+/* Snapshot of allocator health, filled in by mm_stats().  Every field is
+   maintained incrementally on the allocation hot paths, so a scrape does
+   not walk the heap. */
+typedef struct {
+  size_t allocs[MM_NUM_SIZE_CLASSES]; /* allocations served, per size class */
+  size_t frees[MM_NUM_SIZE_CLASSES];  /* deallocations, per size class */
+  size_t live_bytes;        /* heap bytes in allocated blocks right now */
+  size_t peak_live_bytes;   /* high-water mark of live_bytes */
+  size_t heap_bytes;        /* bytes obtained from the memory system */
+  size_t free_blocks;       /* blocks sitting in the free lists */
+  size_t free_bytes;        /* bytes in those blocks */
+  size_t largest_free_block;
+  double fragmentation;     /* 1 - live_bytes / heap_bytes */
+} mm_stats_t;
+
+/* Free-list fit policies, selectable with mm_init_ex. */
+#define MM_FIT_FIRST   0  /* take the first block that fits (default) */
+#define MM_FIT_BEST    1  /* take the smallest block that fits */
+#define MM_FIT_NEXT    2  /* first fit, resuming after the last hit */
+#define MM_FIT_BOUNDED 3  /* first fit, giving up after a few probes */
+
+/* Free-list insertion policies, selectable with mm_set_insert_policy.
+   Address order trades a short insertion scan for better first-fit
+   utilization and cheaper coalescing under long-running churn. */
+#define MM_INSERT_LIFO    0  /* push at the list head (default) */
+#define MM_INSERT_ADDRESS 1  /* keep each class list address-ordered */
 
 extern int mm_init(void);
+extern int mm_init_ex(int policy);
+extern void mm_set_insert_policy(int policy);
 extern void *mm_malloc(size_t size);
+/* Zeroed array allocation; skips the memset on never-written memory. */
+extern void *mm_calloc(size_t nmemb, size_t size);
+/* Allocation aligned to any power of two (cache lines, pages, ...). */
+extern void *mm_memalign(size_t alignment, size_t size);
 extern void mm_free(void *ptr);
+/* Bulk paths: mm_malloc_batch fills out[] with n same-sized blocks,
+   carving batches out of single free blocks, and returns how many it
+   allocated.  mm_free_batch sorts ptrs[] in place and merges
+   address-adjacent runs before coalescing.  Pointers interoperate
+   freely with mm_malloc and mm_free. */
+extern size_t mm_malloc_batch(size_t size, size_t n, void** out);
+extern void mm_free_batch(void** ptrs, size_t n);
 extern void examine_heap();
 
 
 extern void* mm_realloc(void* ptr, size_t size);
+
+/* Conservative mark-sweep collection over everything reachable from the
+   given roots. */
+extern void mm_garbage_collect(void* roots[], int num_roots);
+
+/* Worker threads for the mark phase: 1 keeps marking serial, 0 (the
+   default) uses one per core, capped internally. */
+extern void mm_set_gc_threads(int n);
+
+/* Heap search for leak hunting: store the address of each allocated
+   payload word that points into target's payload in refs[], up to
+   max_refs.  Returns the count, or -1 if target is not allocated. */
+extern int mm_find_references(void* target, void* refs[], int max_refs);
+
+/* Incremental, generational collection.  mm_gc_begin snapshots the
+   roots and opens a cycle; each mm_gc_step does at most ~max_usec of
+   marking/sweeping work and returns nonzero while work remains, so
+   pauses stay bounded regardless of heap size.  A minor cycle only
+   reclaims blocks allocated past the previous cycle's high-water mark. */
+#define MM_GC_FULL  0
+#define MM_GC_MINOR 1
+extern int mm_gc_begin(void* roots[], int num_roots, int generation);
+extern int mm_gc_step(long max_usec);
+
+/* Return idle heap memory to the OS; gives back the bytes released. */
+extern size_t mm_trim(void);
+
+/* O(1) snapshot of the incrementally maintained allocator counters. */
+extern void mm_stats(mm_stats_t* stats);
+
+/* Binary heap snapshot, written by mm_snapshot() and decoded by the
+   offline pretty-printer (SnapshotDumpDriver).  The layout is one
+   mm_snapshot_header_t, then for every in-use arena an
+   mm_snapshot_arena_t followed by one 16-byte mm_snapshot_block_t per
+   block in address order, ending with the zero-sized epilogue record.
+   A final arena record with region == MM_SNAPSHOT_MMAP introduces
+   heap_size-many mm_snapshot_chunk_t records for the mmap'd blocks.
+   All fields are host-endian; block offsets are relative to the
+   arena's base, and 0 stands for a null free-list link (offset 0 is
+   the region's padding word, never a block). */
+#define MM_SNAPSHOT_MAGIC   0x70616e73u  /* "snap" */
+#define MM_SNAPSHOT_VERSION 1
+#define MM_SNAPSHOT_MMAP    0xffffffffu
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+} mm_snapshot_header_t;
+
+typedef struct {
+  uint32_t region;     /* arena index, or MM_SNAPSHOT_MMAP */
+  uint32_t pad;
+  uint64_t base;       /* region base address when the heap was live */
+  uint64_t heap_size;  /* bytes in use (chunk count for the mmap record) */
+  uint32_t free_heads[MM_NUM_SIZE_CLASSES]; /* per-class list heads */
+  uint32_t large_head; /* first block in the large-block skiplist */
+} mm_snapshot_arena_t;
+
+/* For a small free block link0/link1 are the nextFree/prevFree offsets;
+   for a large free block link0 is the next skiplist block and link1 is
+   the node's level with MM_SNAPSHOT_LARGE set.  Used blocks carry
+   zeros.  Tag bits in size_and_tags are as in mm.c: 1 used,
+   2 preceding-used, 4 slab. */
+#define MM_SNAPSHOT_LARGE 0x80000000u
+typedef struct {
+  uint32_t offset;
+  uint32_t size_and_tags;
+  uint32_t link0;
+  uint32_t link1;
+} mm_snapshot_block_t;
+
+typedef struct {
+  uint64_t address;    /* payload address */
+  uint64_t map_size;   /* bytes in the whole mapping */
+  uint64_t size_and_tags;
+} mm_snapshot_chunk_t;
+
+/* Stream a binary snapshot of every arena and mmap chunk to fd in
+   large buffered writes; seconds for a multi-GB heap, where
+   examine_heap's per-block fprintf takes minutes.  Returns 0, or -1 if
+   a write failed. */
+extern int mm_snapshot(int fd);
+
+/* Allocation-site profiling: one in rate allocations records a sampled
+   backtrace, and mm_profile_dump() prints the call sites ranked by
+   estimated live bytes.  Rate 0 (the default) turns sampling off. */
+extern void mm_set_profile_rate(int rate);
+extern void mm_profile_dump(void);
+
+/* Production heap validation: each non-slab allocation reserves one
+   trailing canary word, verified on free together with the block
+   headers around it.  Enable before the first allocation. */
+extern void mm_set_validation(int enabled);
+/* Validate n randomly sampled blocks (O(n), independent of heap size);
+   returns the number of errors found, each also reported on stderr. */
+extern int mm_check_sample(int n);
+
+/* Deferred coalescing: park frees in O(1) and merge them in batches. */
+extern void mm_set_deferred_coalescing(int enabled);
+extern void mm_flush_frees(void);
+
+/* Scoped arenas: bump allocation for objects with one shared lifetime.
+   Objects from mm_arena_alloc are never freed individually; destroying
+   the arena returns its chunks to the allocator whole. */
+typedef struct mm_arena mm_arena_t;
+extern mm_arena_t* mm_arena_create(void);
+extern void* mm_arena_alloc(mm_arena_t* arena, size_t size);
+extern void mm_arena_destroy(mm_arena_t* arena);